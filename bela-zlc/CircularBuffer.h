@@ -0,0 +1,100 @@
+/***** CircularBuffer.h *****/
+/*
+ ____  _____ _        _    
+| __ )| ____| |      / \   
+|  _ \|  _| | |     / _ \  
+| |_) | |___| |___ / ___ \ 
+|____/|_____|_____/_/   \_\
+
+http://bela.io
+
+*/
+
+// This class encapsulates a circular buffer of power-of-two size, so that
+// indices wrap with a mask. It is followed by a guard region which mirrors
+// its start, so that any run of up to guard samples can be read as one
+// contiguous block, and it can overlap-add blocks in at most two runs.
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+class CircularBuffer {
+public:
+	// Constructors: the one with arguments automatically calls setup()
+	CircularBuffer() {}
+	CircularBuffer(unsigned int size, unsigned int guard) { setup(size, guard); }
+	
+	// Allocate a zeroed buffer of at least size samples, rounded up to a
+	// power of two, with guard mirrored samples. Returns true on success.
+	bool setup(unsigned int size, unsigned int guard)
+	{
+		size_ = 1;
+		while (size_ < size)
+			size_ *= 2;
+		mask_ = size_ - 1;
+		guard_ = std::min(guard, size_);
+		buffer_.assign(size_ + guard_, 0);
+		return true;
+	}
+	
+	// retrieve the size of the buffer (without the guard)
+	unsigned int size() { return size_; }
+	
+	// wrap an index into the buffer
+	unsigned int wrap(unsigned int index) { return index & mask_; }
+	
+	// access a sample, index must be less than size()
+	float& operator[](unsigned int index) { return buffer_[index]; }
+	
+	// Write count samples starting at index, which must be less than size()
+	void write(unsigned int index, const float* values, unsigned int count)
+	{
+		unsigned int first = std::min(count, size_ - index);
+		std::copy(values, values + first, buffer_.begin() + index);
+		std::copy(values + first, values + count, buffer_.begin());
+		// keep the guard in sync with the start of the buffer
+		if (index < guard_)
+			std::copy(values, values + std::min(first, guard_ - index), buffer_.begin() + size_ + index);
+		if (count > first)
+			std::copy(values + first, values + first + std::min(count - first, guard_), buffer_.begin() + size_);
+	}
+	
+	// Get a pointer to the count (at most guard) samples that precede end
+	const float* getRun(unsigned int end, unsigned int count)
+	{
+		return buffer_.data() + ((end - count) & mask_);
+	}
+	
+	// Add count samples into the buffer starting at index, which must be
+	// less than size(). Does not update the guard: it is meant for buffers
+	// that are only read through operator[] and read().
+	void add(unsigned int index, const float* values, unsigned int count)
+	{
+		unsigned int first = std::min(count, size_ - index);
+		float* out = buffer_.data() + index;
+		for (unsigned int n = 0; n < first; n++)
+			out[n] += values[n];
+		out = buffer_.data();
+		for (unsigned int n = first; n < count; n++)
+			out[n - first] += values[n];
+	}
+	
+	// Copy count samples starting at index into out and zero them,
+	// so they are ready for the next overlap-add
+	void read(unsigned int index, float* out, unsigned int count)
+	{
+		unsigned int first = std::min(count, size_ - index);
+		std::copy(buffer_.begin() + index, buffer_.begin() + index + first, out);
+		std::fill(buffer_.begin() + index, buffer_.begin() + index + first, 0);
+		std::copy(buffer_.begin(), buffer_.begin() + (count - first), out + first);
+		std::fill(buffer_.begin(), buffer_.begin() + (count - first), 0);
+	}
+	
+private:
+	std::vector<float> buffer_;
+	unsigned int size_ = 0;
+	unsigned int mask_ = 0;
+	unsigned int guard_ = 0;
+};
@@ -1,49 +1,81 @@
 /***** DirectConvolver.cpp *****/
 
 #include "DirectConvolver.h"
+#include <algorithm>
 
 // Constructor taking the path of a file to load
-DirectConvolver::DirectConvolver(std::vector<float> &h, int k, std::vector<float> &x, std::vector<float> &y)
+DirectConvolver::DirectConvolver(std::vector<float> &h, int k, CircularBuffer &x, CircularBuffer &y)
 {
 	setup(h, k, x, y);
 }
 
 // Load an audio file from the given filename. Returns true on success.
-bool DirectConvolver::setup(std::vector<float> &h, int k, std::vector<float> &x, std::vector<float> &y)
+bool DirectConvolver::setup(std::vector<float> &h, int k, CircularBuffer &x, CircularBuffer &y)
 {
 	// store public member values
 	k_ = k;
 	x_ = &x;
 	y_ = &y;
 	outPointer_ = k_;
+	h_.assign(h.rbegin(), h.rend());
+	hActive_->store(-1);
 
-	std::vector<std::vector<float>> hs(1);
-	hs[0]  = h;
-	int ret = cv.setup(hs, h.size());
-	cvIn.reserve(h.size());
-	cvOut.resize(h.size());
-	return !ret;
+	return true;
 }
 
-// Apply the filter h to an input sample in the time domain
+int DirectConvolver::getSize()
+{
+	return h_.size();
+}
+
+void DirectConvolver::setMorphTarget(std::vector<float> &h)
+{
+	hB_ = h;
+	hB_.resize(h_.size(), 0);
+	std::reverse(hB_.begin(), hB_.end());
+	hMorph_[0].resize(h_.size());
+	hMorph_[1].resize(h_.size());
+	// force the next call to morph() to refresh the coefficients
+	morphAmount_ = -1;
+}
+
+// In the time domain a linear blend is the only meaningful one, so this
+// is used for both morph modes
+void DirectConvolver::morph(float amount)
+{
+	if(!hB_.size())
+		return;
+	// write into the blend which is not in use and then switch over to it.
+	// The release store orders the writes to the blend before the switch,
+	// so that the audio thread never sees a half-written filter
+	int next = (0 == hActive_->load(std::memory_order_relaxed)) ? 1 : 0;
+	for(size_t n = 0; n < h_.size(); ++n)
+		hMorph_[next][n] = h_[n] + amount * (hB_[n] - h_[n]);
+	hActive_->store(next, std::memory_order_release);
+	morphAmount_ = amount;
+}
+
+bool DirectConvolver::isMorphed(float amount)
+{
+	return !hB_.size() || amount == morphAmount_;
+}
+
+// Apply the filter h to the input in the time domain, one sample at a time
 void DirectConvolver::process(unsigned int inPointer)
 {
-	return;
-	// receive one sample at a time and keep a copy
-	cvIn.push_back(x_->data()[inPointer]);
-	if(cvIn.capacity() == cvIn.size())
-	{
-		// once the buffer is full, perform the convolution for the whole block
-		cv.process(cvOut.data(), cvIn.data(), cvIn.size());
-		cvIn.resize(0);
-		// add the result of the convolution into the output buffer
-		for(size_t n = 0; n < cvOut.size(); ++n)
-		{
-			// write output sample to the output circular buffer
-			int circularBufferIndex = (outPointer_ + y_->size()) % y_->size();
-			y_->data()[circularBufferIndex] += cvOut[n];
-			// update the write pointer one sample ahead
-			outPointer_ = (outPointer_ + 1) % y_->size();
-		}
-	}
+	// coefficients currently in use (see morph())
+	int active = hActive_->load(std::memory_order_acquire);
+	const float *h = (active < 0) ? h_.data() : hMorph_[active].data();
+
+	// multiply the filter with the most recent input samples, which are
+	// contiguous thanks to the guard of the input buffer
+	const float *x = x_->getRun(inPointer, h_.size());
+	float out = 0;
+	for(size_t n = 0; n < h_.size(); ++n)
+		out += h[n] * x[n];
+
+	// write output sample to the output circular buffer
+	(*y_)[outPointer_] += out;
+	// update the write pointer one sample ahead
+	outPointer_ = y_->wrap(outPointer_ + 1);
 }
@@ -18,30 +18,52 @@ http://bela.io
 #include <vector>
 #include <string>
 #include <memory>
-#include <libraries/Convolver/Convolver.h>
+#include <atomic>
+
+#include "CircularBuffer.h"
 
 class DirectConvolver
 {
 public:
 	// Constructors: the one with arguments automatically calls setup()
 	DirectConvolver() {}
-	DirectConvolver(std::vector<float> &h, int k, std::vector<float> &x, std::vector<float> &y);
+	DirectConvolver(std::vector<float> &h, int k, CircularBuffer &x, CircularBuffer &y);
 
 	// Create a direct convolution object. Returns true on success.
-	bool setup(std::vector<float> &h, int k, std::vector<float> &x, std::vector<float> &y);
+	bool setup(std::vector<float> &h, int k, CircularBuffer &x, CircularBuffer &y);
 
+	// Compute one output sample from the input samples preceding inPointer
 	void process(unsigned int inPointer);
 
+	// retrieve the number of filter coefficients
+	int getSize(void);
+
+	// Store a second impulse response block to morph towards.
+	// Not safe while process() or morph() may be running.
+	void setMorphTarget(std::vector<float> &h);
+
+	// Blend the coefficients (0: original block, 1: morph target).
+	// Call off the audio thread.
+	void morph(float amount);
+
+	// check if the coefficients in use already are the requested blend
+	bool isMorphed(float amount);
+
 	// Destructor
 	~DirectConvolver() {}
 
 private:
-	Convolver cv;
 	int k_;					  // block (sample) offset within the complete filter
-	std::vector<float> cvIn;
-	std::vector<float> cvOut;
-	std::vector<float> *x_;	  // pointer to the input circular buffer
-	std::vector<float> *y_;	  // pointer to the output circular buffer
+	CircularBuffer *x_;		  // pointer to the input circular buffer
+	CircularBuffer *y_;		  // pointer to the output circular buffer
+	// The coefficients below are stored in reverse order, oldest input
+	// sample first, so that the filter is a dot product with a run of input
 	std::vector<float> h_;	  // internal copy of the filter coefficients
+	std::vector<float> hB_;	  // morph target coefficients
+	std::vector<float> hMorph_[2]; // double-buffered blends of h_ and hB_
+	// blend in use, or -1 for h_. Shared so that the convolver stays
+	// copyable, like the mutexes of FFTConvolver
+	std::shared_ptr<std::atomic<int>> hActive_ = std::make_shared<std::atomic<int>>(-1);
+	float morphAmount_ = 0;	  // blend currently in use
 	unsigned int outPointer_; // tracking position to write in the output buffer
 };
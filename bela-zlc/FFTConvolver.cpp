@@ -1,6 +1,7 @@
 /***** FFTConvolver.cpp *****/
 
 #include "FFTConvolver.h"
+#include <cmath>
 
 #define CHECK_WRITE_MUTEX
 #define LOCK_WRITE_MUTEX
@@ -8,7 +9,7 @@
 RtMutex FFTConvolver::writeMutex;
 
 // Constructor taking the path of a file to load
-FFTConvolver::FFTConvolver(int fftSize, std::vector<float>& h, int k, std::vector<float>& x, std::vector<float>& y, int idx)
+FFTConvolver::FFTConvolver(int fftSize, std::vector<float>& h, int k, CircularBuffer& x, CircularBuffer& y, int idx)
 {
 	// FFT size must always be twice as large as block of samples
 	assert (fftSize == 2 * h.size()); 
@@ -17,7 +18,7 @@ FFTConvolver::FFTConvolver(int fftSize, std::vector<float>& h, int k, std::vecto
 }
 
 // Load an audio file from the given filename. Returns true on success.
-bool FFTConvolver::setup(int fftSize, std::vector<float>& h, int k, std::vector<float>& x, std::vector<float>& y, int idx)
+bool FFTConvolver::setup(int fftSize, std::vector<float>& h, int k, CircularBuffer& x, CircularBuffer& y, int idx)
 {
 	// store public member values
 	fftSize_ = fftSize;
@@ -61,6 +62,149 @@ int FFTConvolver::getFftSize()
 	return fftSize_;
 }
 
+int FFTConvolver::getOffset()
+{
+	return k_;
+}
+
+void FFTConvolver::setMorphTarget(std::vector<float>& h)
+{
+	int bins = fftSize_/2 + 1;
+	
+	// keep a copy of the original spectrum the first time around,
+	// as fftH will be overwritten with the blend
+	if (!hARe_.size())
+	{
+		hARe_.resize(bins);
+		hAIm_.resize(bins);
+		for (int n = 0; n < bins; n++)
+		{
+			hARe_[n] = fftH->fdr(n);
+			hAIm_[n] = fftH->fdi(n);
+		}
+	}
+	
+	// compute the spectrum of the target block
+	if (!fftMorph)
+	{
+		fftMorph = std::make_shared<Fft>();
+		fftMorph->setup(fftSize_);
+	}
+	for (int n = 0; n < fftSize_; n++)
+	{
+		if (n < fftSize_/2 && n < h.size())
+			fftMorph->td(n) = h[n];
+		else
+			fftMorph->td(n) = 0.0;
+	}
+	fftMorph->fft();
+	
+	hBRe_.resize(bins);
+	hBIm_.resize(bins);
+	magA_.resize(bins);
+	magB_.resize(bins);
+	phaseA_.resize(bins);
+	phaseDelta_.resize(bins);
+	hNextRe_.resize(bins);
+	hNextIm_.resize(bins);
+	for (int n = 0; n < bins; n++)
+	{
+		hBRe_[n] = fftMorph->fdr(n);
+		hBIm_[n] = fftMorph->fdi(n);
+		magA_[n] = hypotf(hARe_[n], hAIm_[n]);
+		magB_[n] = hypotf(hBRe_[n], hBIm_[n]);
+		phaseA_[n] = atan2f(hAIm_[n], hARe_[n]);
+		// wrap the phase difference so that we rotate along the shortest path
+		float delta = atan2f(hBIm_[n], hBRe_[n]) - phaseA_[n];
+		if (delta > M_PI)
+			delta -= 2 * M_PI;
+		else if (delta < -M_PI)
+			delta += 2 * M_PI;
+		phaseDelta_[n] = delta;
+	}
+	
+	// force the next call to morph() to refresh fftH, straight away
+	morphAmount_ = -1;
+	morphQueues_ = queues_->load() - 1;
+}
+
+void FFTConvolver::morph(float amount, int mode)
+{
+	if (!hBRe_.size())
+		return;
+	morphQueues_ = queues_->load(std::memory_order_acquire);
+	
+	// compute the blend outside of the lock, so that process() is
+	// only held back for the time it takes to copy it into fftH
+	int bins = fftSize_/2 + 1;
+	if (kMorphPolar == mode)
+	{
+		for (int n = 0; n < bins; n++)
+		{
+			float mag = magA_[n] + amount * (magB_[n] - magA_[n]);
+			float phase = phaseA_[n] + amount * phaseDelta_[n];
+			hNextRe_[n] = mag * cosf(phase);
+			hNextIm_[n] = mag * sinf(phase);
+		}
+		
+		// unlike the complex blend, this one is not the spectrum of a
+		// block of fftSize/2 samples any more: its impulse response spills
+		// into the zero-padded half, which would wrap around in the
+		// circular convolution. Truncate it back to the length of the block.
+		for (int n = 0; n < fftSize_; n++)
+		{
+			if (n < bins)
+			{
+				fftMorph->fdr(n) = hNextRe_[n];
+				fftMorph->fdi(n) = hNextIm_[n];
+			}
+			else
+			{
+				fftMorph->fdr(n) = hNextRe_[fftSize_ - n];
+				fftMorph->fdi(n) = -hNextIm_[fftSize_ - n];
+			}
+		}
+		fftMorph->ifft();
+		for (int n = fftSize_/2; n < fftSize_; n++)
+			fftMorph->td(n) = 0.0;
+		fftMorph->fft();
+		for (int n = 0; n < bins; n++)
+		{
+			hNextRe_[n] = fftMorph->fdr(n);
+			hNextIm_[n] = fftMorph->fdi(n);
+		}
+	}
+	else
+	{
+		for (int n = 0; n < bins; n++)
+		{
+			hNextRe_[n] = hARe_[n] + amount * (hBRe_[n] - hARe_[n]);
+			hNextIm_[n] = hAIm_[n] + amount * (hBIm_[n] - hAIm_[n]);
+		}
+	}
+	
+	hMutex_->lock();
+	for (int n = 0; n < bins; n++)
+	{
+		fftH->fdr(n) = hNextRe_[n];
+		fftH->fdi(n) = hNextIm_[n];
+	}
+	hMutex_->unlock();
+	
+	morphAmount_ = amount;
+	morphMode_ = mode;
+}
+
+bool FFTConvolver::isMorphed(float amount, int mode)
+{
+	return !hBRe_.size() || (amount == morphAmount_ && mode == morphMode_);
+}
+
+bool FFTConvolver::isMorphDue()
+{
+	return queues_->load(std::memory_order_acquire) != morphQueues_;
+}
+
 void FFTConvolver::queue(unsigned int inPointer, bool bypass)
 {
 #ifdef LOCK_QUEUE_MUTEX
@@ -72,6 +216,7 @@ void FFTConvolver::queue(unsigned int inPointer, bool bypass)
 		inPointer_ = inPointer;
 		queued_ = true;
 		bypass_ = bypass;
+		queues_->fetch_add(1, std::memory_order_release);
 #ifdef LOCK_QUEUE_MUTEX
 		queueMutex->unlock();
 #endif // LOCK_QUEUE_MUTEX
@@ -88,37 +233,33 @@ void FFTConvolver::process()
 #ifdef LOCK_QUEUE_MUTEX
 		queueMutex->lock();
 #endif // LOCK_QUEUE_MUTEX
-		// first grab fftsize/2 samples from the input circular buffer 
-		for (int n = 0; n < fftSize_; n++)
-		{
-			if (n < fftSize_/2)
-			{
-				int circularBufferIndex = (inPointer_ + n - (fftSize_/2) + x_->size()) % x_->size();
-				fftX->td(n) = x_->data()[circularBufferIndex];
-			}
-			else
-			{
-				fftX->td(n) = 0.0;
-			}
-		}
+		// first grab fftsize/2 samples from the input circular buffer,
+		// which are contiguous thanks to its guard, and zero-pad them
+		const float* in = x_->getRun(inPointer_, fftSize_/2);
+		std::copy(in, in + fftSize_/2, &fftX->td(0));
+		std::fill(&fftX->td(0) + fftSize_/2, &fftX->td(0) + fftSize_, 0.f);
 		
 		// compute fft of the input block
 		fftX->fft();
 	
 		// complex multiplication to apply filter in freq. domain
+		// up to and including the Nyquist bin; the spectrum of a real
+		// signal is conjugate-symmetric, so the upper half mirrors bin fftSize - n
+		hMutex_->lock();
 		for (int n = 0; n < fftSize_; n++) 
 		{
-			if (n < fftSize_/2)
+			if (n <= fftSize_/2)
 			{
 				fftBuffer->fdr(n) = (fftX->fdr(n) * fftH->fdr(n)) - (fftX->fdi(n) * fftH->fdi(n));
 				fftBuffer->fdi(n) = (fftX->fdi(n) * fftH->fdr(n)) + (fftX->fdr(n) * fftH->fdi(n));
 			}
 			else
 			{
-				fftBuffer->fdr(n) = fftBuffer->fdr(fftSize_ - n - 1);
-				fftBuffer->fdi(n) = fftBuffer->fdr(fftSize_ - n - 1);
+				fftBuffer->fdr(n) = fftBuffer->fdr(fftSize_ - n);
+				fftBuffer->fdi(n) = -fftBuffer->fdi(fftSize_ - n);
 			}
 		}
+		hMutex_->unlock();
 		
 		// compute time domain output with IFFT
 		fftBuffer->ifft();
@@ -135,10 +276,7 @@ void FFTConvolver::process()
 		writeMutex.lock();
 #endif
 #endif // LOCK_WRITE_MUTEX
-		for(int n = 0; n < fftSize_; n++) {
-			int circularBufferIndex = (outPointer_ + n + y_->size()) % y_->size();
-			y_->data()[circularBufferIndex] += fftBuffer->td(n);
-		}
+		y_->add(outPointer_, &fftBuffer->td(0), fftSize_);
 #ifdef LOCK_WRITE_MUTEX
 		writeMutex.unlock();
 #endif // LOCK_WRITE_MUTEX
@@ -148,7 +286,7 @@ void FFTConvolver::process()
 	}
 	
 	// update the write pointer (even on bypass)
-	outPointer_ = (outPointer_ + (fftSize_/2)) % y_->size();
+	outPointer_ = y_->wrap(outPointer_ + (fftSize_/2));
 	
 	queued_ = false;
 }
@@ -19,15 +19,25 @@ http://bela.io
 #include <vector>
 #include <string>
 #include <memory>
+#include <atomic>
+
+#include "CircularBuffer.h"
 
 class FFTConvolver {
 public:
+	// How the spectra of two impulse responses are blended when morphing
+	enum MorphMode {
+		kMorphComplex = 0,	// linear interpolation of the complex spectra
+		kMorphPolar,		// interpolation of magnitude and (shortest path) phase,
+							// truncated back to the length of the block
+	};
+	
 	// Constructors: the one with arguments automatically calls setup()
 	FFTConvolver() {}
-	FFTConvolver(int fftSize, std::vector<float>& h, int k, std::vector<float>& x, std::vector<float>& y, int idx);
+	FFTConvolver(int fftSize, std::vector<float>& h, int k, CircularBuffer& x, CircularBuffer& y, int idx);
 	
 	// Load an audio file from the given filename. Returns true on success.
-	bool setup(int fftSize, std::vector<float>& h, int k, std::vector<float>& x, std::vector<float>& y, int idx);
+	bool setup(int fftSize, std::vector<float>& h, int k, CircularBuffer& x, CircularBuffer& y, int idx);
 	
 	// check if the convolver has been queued
 	bool isQueued(void);
@@ -35,6 +45,25 @@ public:
 	// retrieve the FFT size
 	int getFftSize(void);
 	
+	// retrieve the block offset within the complete filter
+	int getOffset(void);
+	
+	// Store the spectrum of a second impulse response block to morph towards.
+	// Not safe while process() or morph() may be running.
+	void setMorphTarget(std::vector<float>& h);
+	
+	// Blend the two spectra (0: original block, 1: morph target) into the
+	// active filter. Call off the audio thread.
+	void morph(float amount, int mode);
+	
+	// check if the active filter already is the requested blend
+	bool isMorphed(float amount, int mode);
+	
+	// check if the convolver has been queued since the last call to
+	// morph(): the filter is only read once per block, so blending it more
+	// often than that is wasted work
+	bool isMorphDue(void);
+	
 	// Queue a block by passing the starting location in the input buffer
 	void queue(unsigned int inPointer, bool bypass);
 	
@@ -48,6 +77,7 @@ private:
 	
 	// FFT objects
 	std::shared_ptr<Fft> fftBuffer, fftH, fftX;
+	std::shared_ptr<Fft> fftMorph;	// used by setMorphTarget() and morph() only
 	
 	bool queued_ = false;		// whether the filter block samples are ready
 	int fftSize_;			// size of the fft with h = fftSize/2
@@ -55,9 +85,22 @@ private:
 	int idx_;
 	bool bypass_;			// do not process, but update the write pointer
 	
-	std::vector<float>* x_;		// pointer to input circular buffer
+	// Morphing: spectra (bins 0 to fftSize/2) of the original block (A)
+	// and of the morph target (B), in both cartesian and polar form
+	std::vector<float> hARe_, hAIm_, hBRe_, hBIm_;
+	std::vector<float> magA_, magB_, phaseA_, phaseDelta_;
+	std::vector<float> hNextRe_, hNextIm_;	// blend being computed
+	float morphAmount_ = 0;		// blend currently in fftH
+	int morphMode_ = kMorphComplex;
+	unsigned int morphQueues_ = 0;	// value of queues_ when fftH was last blended
+	// number of times the convolver has been queued. Shared so that the
+	// convolver stays copyable
+	std::shared_ptr<std::atomic<unsigned int>> queues_ = std::make_shared<std::atomic<unsigned int>>(0);
+	std::shared_ptr<RtMutex> hMutex_ = std::make_shared<RtMutex>(); // guards fftH
+	
+	CircularBuffer* x_;		// pointer to input circular buffer
 	unsigned int inPointer_;	// read position within the input circular buffer
-	std::vector<float>* y_;		// pointer to the output circular buffer
+	CircularBuffer* y_;		// pointer to the output circular buffer
 	unsigned int outPointer_;	// write position within the output circular buffer
 	
 };
@@ -0,0 +1,194 @@
+/***** PostProcessor.cpp *****/
+
+#include "PostProcessor.h"
+#include <algorithm>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define POSTPROCESSOR_NEON
+#endif
+
+void Ramp::setup(unsigned int length, float value)
+{
+	length_ = std::max(1u, length);
+	setValue(value);
+}
+
+void Ramp::setValue(float value)
+{
+	value_ = value;
+	target_ = value;
+	step_ = 0;
+	remaining_ = 0;
+}
+
+void Ramp::setTarget(float target)
+{
+	if (target == target_)
+		return;
+	target_ = target;
+	remaining_ = length_;
+	step_ = (target_ - value_) / length_;
+}
+
+unsigned int Ramp::advance(unsigned int frames)
+{
+	unsigned int ramping = std::min(frames, remaining_);
+	remaining_ -= ramping;
+	if (remaining_)
+		value_ += step_ * ramping;
+	else
+	{
+		// land exactly on the target
+		value_ = target_;
+		step_ = 0;
+	}
+	return ramping;
+}
+
+float Ramp::getValue()
+{
+	return value_;
+}
+
+float Ramp::getStep()
+{
+	return step_;
+}
+
+void Ramp::apply(float* buffer, unsigned int frames)
+{
+	float start = value_;
+	float increment = step_;
+	unsigned int ramping = advance(frames);
+	for (unsigned int n = 0; n < ramping; n++)
+		buffer[n] *= start + increment * n;
+	for (unsigned int n = ramping; n < frames; n++)
+		buffer[n] *= value_;
+}
+
+PostProcessor::PostProcessor(unsigned int rampLength)
+{
+	setup(rampLength);
+}
+
+bool PostProcessor::setup(unsigned int rampLength)
+{
+	wetGain_.setup(rampLength, 0);
+	dryGain_.setup(rampLength, 0);
+	started_ = false;
+	return true;
+}
+
+// [7/6] Pade approximant of tanh: within 1e-4 of it over the clipped range
+float PostProcessor::saturate(float x)
+{
+	x = std::min(5.f, std::max(-5.f, x));
+	float x2 = x * x;
+	float num = x * (135135.f + x2 * (17325.f + x2 * (378.f + x2)));
+	float den = 135135.f + x2 * (62370.f + x2 * (3150.f + x2 * 28.f));
+	return std::min(1.f, std::max(-1.f, num / den));
+}
+
+#ifdef POSTPROCESSOR_NEON
+static inline float32x4_t saturate4(float32x4_t x)
+{
+	x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(-5.f)), vdupq_n_f32(5.f));
+	float32x4_t x2 = vmulq_f32(x, x);
+	float32x4_t num = vaddq_f32(vdupq_n_f32(378.f), x2);
+	num = vmlaq_f32(vdupq_n_f32(17325.f), x2, num);
+	num = vmlaq_f32(vdupq_n_f32(135135.f), x2, num);
+	num = vmulq_f32(x, num);
+	float32x4_t den = vmlaq_f32(vdupq_n_f32(3150.f), x2, vdupq_n_f32(28.f));
+	den = vmlaq_f32(vdupq_n_f32(62370.f), x2, den);
+	den = vmlaq_f32(vdupq_n_f32(135135.f), x2, den);
+	// divide with a reciprocal estimate refined by two Newton-Raphson steps
+	float32x4_t r = vrecpeq_f32(den);
+	r = vmulq_f32(vrecpsq_f32(den, r), r);
+	r = vmulq_f32(vrecpsq_f32(den, r), r);
+	float32x4_t y = vmulq_f32(num, r);
+	return vminq_f32(vmaxq_f32(y, vdupq_n_f32(-1.f)), vdupq_n_f32(1.f));
+}
+#endif // POSTPROCESSOR_NEON
+
+void PostProcessor::mix(float* out, unsigned int stride, const float* wet, const float* dry,
+	unsigned int frames, float wetGain, float wetStep, float dryGain, float dryStep, bool saturating)
+{
+	unsigned int n = 0;
+#ifdef POSTPROCESSOR_NEON
+	const float ramp[4] = { 0, 1, 2, 3 };
+	float32x4_t index = vld1q_f32(ramp);
+	float32x4_t wetGains = vmlaq_n_f32(vdupq_n_f32(wetGain), index, wetStep);
+	float32x4_t dryGains = vmlaq_n_f32(vdupq_n_f32(dryGain), index, dryStep);
+	float32x4_t wetIncrement = vdupq_n_f32(4 * wetStep);
+	float32x4_t dryIncrement = vdupq_n_f32(4 * dryStep);
+	for (; n + 4 <= frames; n += 4)
+	{
+		float32x4_t y = vmulq_f32(vld1q_f32(wet + n), wetGains);
+		y = vmlaq_f32(y, vld1q_f32(dry + n), dryGains);
+		if (saturating)
+			y = saturate4(y);
+		if (1 == stride)
+			vst1q_f32(out + n, y);
+		else
+		{
+			out[n * stride] = vgetq_lane_f32(y, 0);
+			out[(n + 1) * stride] = vgetq_lane_f32(y, 1);
+			out[(n + 2) * stride] = vgetq_lane_f32(y, 2);
+			out[(n + 3) * stride] = vgetq_lane_f32(y, 3);
+		}
+		wetGains = vaddq_f32(wetGains, wetIncrement);
+		dryGains = vaddq_f32(dryGains, dryIncrement);
+	}
+#endif // POSTPROCESSOR_NEON
+	// remaining samples (all of them without NEON)
+	for (; n < frames; n++)
+	{
+		float y = wet[n] * (wetGain + wetStep * n) + dry[n] * (dryGain + dryStep * n);
+		if (saturating)
+			y = saturate(y);
+		out[n * stride] = y;
+	}
+}
+
+void PostProcessor::process(float* out, unsigned int stride, const float* wet, const float* dry,
+	unsigned int frames, float wetGain, float dryGain, bool saturating)
+{
+	if (!started_)
+	{
+		// start from the first values we are given rather than ramping up
+		wetGain_.setValue(wetGain);
+		dryGain_.setValue(dryGain);
+		started_ = true;
+	}
+	wetGain_.setTarget(wetGain);
+	dryGain_.setTarget(dryGain);
+
+	float wetStart = wetGain_.getValue();
+	float wetStep = wetGain_.getStep();
+	float dryStart = dryGain_.getValue();
+	float dryStep = dryGain_.getStep();
+	unsigned int wetRamping = wetGain_.advance(frames);
+	unsigned int dryRamping = dryGain_.advance(frames);
+
+	// split the block where each of the ramps ends: in most blocks neither
+	// is ramping and this is a single pass with constant gains
+	unsigned int ends[3] = {
+		std::min(wetRamping, dryRamping),
+		std::max(wetRamping, dryRamping),
+		frames
+	};
+	unsigned int start = 0;
+	for (unsigned int end : ends)
+	{
+		if (end <= start)
+			continue;
+		bool wetRamp = start < wetRamping;
+		bool dryRamp = start < dryRamping;
+		mix(out + start * stride, stride, wet + start, dry + start, end - start,
+			wetRamp ? wetStart + wetStep * start : wetGain_.getValue(), wetRamp ? wetStep : 0,
+			dryRamp ? dryStart + dryStep * start : dryGain_.getValue(), dryRamp ? dryStep : 0,
+			saturating);
+		start = end;
+	}
+}
@@ -0,0 +1,82 @@
+/***** PostProcessor.h *****/
+/*
+ ____  _____ _        _    
+| __ )| ____| |      / \   
+|  _ \|  _| | |     / _ \  
+| |_) | |___| |___ / ___ \ 
+|____/|_____|_____/_/   \_\
+
+http://bela.io
+
+*/
+
+// This class applies the wet/dry mix, output gain and saturation to whole
+// blocks of one channel, writing the result straight into the output.
+
+#pragma once
+
+#include <vector>
+
+// Linear ramp towards a target value over a fixed number of samples,
+// used to smooth the gains set from the GUI
+class Ramp {
+public:
+	// Set the length of the ramp and jump to value
+	void setup(unsigned int length, float value);
+	
+	// Jump to value, stopping any ramp
+	void setValue(float value);
+	
+	// Set the value to ramp to. Restarts the ramp if it changed
+	void setTarget(float target);
+	
+	// Multiply buffer in place by the ramp, advancing it by frames
+	void apply(float* buffer, unsigned int frames);
+	
+	// Advance the ramp by frames. Returns the number of those frames
+	// (from the start of the block) over which the value changes
+	unsigned int advance(unsigned int frames);
+	
+	// retrieve the current value
+	float getValue(void);
+	
+	// retrieve the increment per sample, 0 when not ramping
+	float getStep(void);
+	
+private:
+	float value_ = 0;			// current value
+	float step_ = 0;			// increment per sample
+	float target_ = 0;
+	unsigned int length_ = 1;
+	unsigned int remaining_ = 0;	// samples left in the current ramp
+};
+
+class PostProcessor {
+public:
+	// Constructors: the one with arguments automatically calls setup()
+	PostProcessor() {}
+	PostProcessor(unsigned int rampLength);
+	
+	// Set the length of the gain ramps in samples. Returns true on success.
+	bool setup(unsigned int rampLength);
+	
+	// Compute (wet * wetGain + dry * dryGain), ramping the gains from their
+	// previous values, saturate it if required and write frames samples to
+	// out, one every stride (1 for non-interleaved, or the number of
+	// channels for interleaved buffers).
+	void process(float* out, unsigned int stride, const float* wet, const float* dry,
+		unsigned int frames, float wetGain, float dryGain, bool saturating);
+	
+	// tanh approximation, clipped to +/-1. Matches the vectorised one.
+	static float saturate(float x);
+	
+private:
+	// Process frames samples with gains changing by wetStep and dryStep
+	// per sample
+	void mix(float* out, unsigned int stride, const float* wet, const float* dry,
+		unsigned int frames, float wetGain, float wetStep, float dryGain, float dryStep, bool saturating);
+	
+	Ramp wetGain_;
+	Ramp dryGain_;
+	bool started_ = false;		// whether the gains have ever been set
+};
@@ -0,0 +1,136 @@
+/***** StreamingPlayer.cpp *****/
+
+#include "StreamingPlayer.h"
+#include <algorithm>
+
+// Constructor taking the path of a file to stream
+StreamingPlayer::StreamingPlayer(std::string filename, unsigned int bufferSize, unsigned int chunkSize)
+{
+	setup(filename, bufferSize, chunkSize);
+}
+
+bool StreamingPlayer::setup(std::string filename, unsigned int bufferSize, unsigned int chunkSize)
+{
+	filename_ = filename;
+	info_.format = 0;
+	file_ = sf_open(filename_.c_str(), SFM_READ, &info_);
+	if (!file_)
+	{
+		printf("Error opening audio file '%s': %s\n", filename_.c_str(), sf_strerror(file_));
+		return false;
+	}
+	if (!info_.frames)
+	{
+		printf("Audio file '%s' is empty\n", filename_.c_str());
+		return false;
+	}
+
+	// a power of two size lets the pointers wrap with a mask
+	unsigned int size = 1;
+	while (size < bufferSize)
+		size *= 2;
+	buffer_.resize(size);
+	mask_ = size - 1;
+	chunkSize_ = std::min(chunkSize, size);
+	chunk_.resize(chunkSize_ * info_.channels);
+	writePointer_ = 0;
+	readPointer_ = 0;
+
+	// fill the buffer up front so that we can start playing straight away
+	fill();
+
+	readerThread_ = Bela_createAuxiliaryTask(readerLauncher, priority_, "streamingPlayer", this);
+
+	return true;
+}
+
+StreamingPlayer::~StreamingPlayer()
+{
+	if (file_)
+		sf_close(file_);
+}
+
+unsigned int StreamingPlayer::getNumFrames()
+{
+	return info_.frames;
+}
+
+unsigned int StreamingPlayer::getUnderruns()
+{
+	return underruns_;
+}
+
+void StreamingPlayer::fill()
+{
+	unsigned int writePointer = writePointer_.load(std::memory_order_relaxed);
+	unsigned int space = buffer_.size() - (writePointer - readPointer_.load(std::memory_order_acquire));
+
+	bool rewound = false;
+	while (space)
+	{
+		sf_count_t frames = sf_readf_float(file_, chunk_.data(), std::min(space, chunkSize_));
+		if (frames <= 0)
+		{
+			// end of file: loop back to the start. If that fails, or if
+			// nothing can be read right after it, give up until the next
+			// wake-up rather than spinning in this thread
+			if (rewound || sf_seek(file_, 0, SEEK_SET) < 0)
+			{
+				if (!readFailed_)
+					rt_printf("StreamingPlayer: error reading '%s'\n", filename_.c_str());
+				readFailed_ = true;
+				break;
+			}
+			rewound = true;
+			continue;
+		}
+		rewound = false;
+		readFailed_ = false;
+		for (sf_count_t n = 0; n < frames; n++)
+			buffer_[(writePointer + n) & mask_] = chunk_[n * info_.channels];
+		writePointer += frames;
+		space -= frames;
+		// publish every chunk so the audio thread can use it right away
+		writePointer_.store(writePointer, std::memory_order_release);
+	}
+	fillQueued_ = false;
+
+	unsigned int underruns = underruns_;
+	if (underruns != reportedUnderruns_)
+	{
+		rt_printf("StreamingPlayer: %u underruns reading '%s'\n", underruns, filename_.c_str());
+		reportedUnderruns_ = underruns;
+	}
+}
+
+void StreamingPlayer::process(float* out, unsigned int frames)
+{
+	unsigned int readPointer = readPointer_.load(std::memory_order_relaxed);
+	unsigned int available = writePointer_.load(std::memory_order_acquire) - readPointer;
+	unsigned int count = std::min(frames, available);
+
+	// copy what is there, in up to two runs either side of the wrap point
+	unsigned int start = readPointer & mask_;
+	unsigned int first = std::min(count, (unsigned int)buffer_.size() - start);
+	std::copy(buffer_.begin() + start, buffer_.begin() + start + first, out);
+	std::copy(buffer_.begin(), buffer_.begin() + (count - first), out + first);
+	readPointer_.store(readPointer + count, std::memory_order_release);
+
+	// wake the reader once there is room for a whole chunk
+	if (buffer_.size() - (available - count) >= chunkSize_ && !fillQueued_)
+	{
+		fillQueued_ = true;
+		Bela_scheduleAuxiliaryTask(readerThread_);
+	}
+
+	if (count < frames)
+	{
+		std::fill(out + count, out + frames, 0);
+		// count each run of missing samples once
+		if (!underrun_)
+			underruns_++;
+		underrun_ = true;
+	}
+	else if (count)
+		underrun_ = false;
+}
@@ -0,0 +1,79 @@
+/***** StreamingPlayer.h *****/
+/*
+ ____  _____ _        _    
+| __ )| ____| |      / \   
+|  _ \|  _| | |     / _ \  
+| |_) | |___| |___ / ___ \ 
+|____/|_____|_____/_/   \_\
+
+http://bela.io
+
+*/
+
+// This class streams the first channel of an audio file from disk, looping
+// at the end. A background thread keeps a lock-free ring buffer topped up
+// in large chunks, so memory use does not depend on the file length.
+
+#pragma once
+
+#include <Bela.h>
+#include <sndfile.h>
+#include <vector>
+#include <string>
+#include <atomic>
+
+class StreamingPlayer {
+public:
+	// Constructors: the one with arguments automatically calls setup()
+	StreamingPlayer() {}
+	StreamingPlayer(std::string filename, unsigned int bufferSize = 131072, unsigned int chunkSize = 8192);
+	
+	// Open the file and fill the ring buffer. bufferSize is rounded up to a
+	// power of two. Returns true on success.
+	bool setup(std::string filename, unsigned int bufferSize = 131072, unsigned int chunkSize = 8192);
+	
+	// Destructor
+	~StreamingPlayer();
+	
+	// After passing pointer to player, refill the ring buffer
+	static void readerLauncher(void * playerPtr)
+	{
+		((StreamingPlayer *) playerPtr)->fill();
+	}
+	
+	// Get the next frames samples into out. Call from the audio thread.
+	// Fills in 0 and counts an underrun if the reader has not kept up.
+	void process(float* out, unsigned int frames);
+	
+	// retrieve the length of the file in frames
+	unsigned int getNumFrames(void);
+	
+	// retrieve the number of underruns (runs of missing samples) so far
+	unsigned int getUnderruns(void);
+	
+private:
+	// Read from the file into the ring buffer until it is full
+	void fill();
+	
+	SNDFILE* file_ = nullptr;
+	SF_INFO info_;
+	std::string filename_;
+	std::vector<float> chunk_;			// interleaved frames read from the file
+	unsigned int chunkSize_;			// frames per read
+	
+	// Single producer (reader thread), single consumer (audio thread) ring
+	// buffer. The pointers are free running and wrap with mask_.
+	std::vector<float> buffer_;
+	unsigned int mask_;
+	std::atomic<unsigned int> writePointer_{0};
+	std::atomic<unsigned int> readPointer_{0};
+	std::atomic<bool> fillQueued_{false};	// the reader has been scheduled
+	
+	bool readFailed_ = false;			// the last read from the file failed
+	bool underrun_ = false;				// the last sample was missing
+	std::atomic<unsigned int> underruns_{0};
+	unsigned int reportedUnderruns_ = 0;
+	
+	int priority_ = 10;					// below the convolver threads
+	AuxiliaryTask readerThread_;
+};
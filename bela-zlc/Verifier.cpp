@@ -0,0 +1,379 @@
+/***** Verifier.cpp *****/
+
+#include "Verifier.h"
+#include "ZLConvolver.h"
+#include <libraries/AudioFile/AudioFile.h>
+#include <libraries/Fft/Fft.h>
+#include <cmath>
+
+static const char* variantNames[Verifier::kNumVariants] = {
+	"process",
+	"block",
+};
+
+static const char* morphNames[Verifier::kNumMorphs] = {
+	"none",
+	"complex",
+	"polar",
+};
+
+// Bela block sizes
+static const int blockSizes[] = { 2, 4, 8, 16, 32, 64, 128 };
+
+// morphs towards the next file: both modes halfway, and all the way with
+// the magnitude/phase one
+static const struct {
+	int morph;
+	float amount;
+} morphSettings[] = {
+	{ Verifier::kMorphNone, 0 },
+	{ Verifier::kMorphComplex, 0.5 },
+	{ Verifier::kMorphPolar, 0.5 },
+	{ Verifier::kMorphPolar, 1 },
+};
+
+// GUI settings for maxBlocks and sparsity
+static const struct {
+	int maxBlocks;
+	float sparsity;
+} bypassSettings[] = {
+	{ 30, 0 },
+	{ 4, 0 },
+	{ 30, 0.5 },
+};
+
+// Bela's default block size, used for the full length and bypass checks
+static const int defaultBlockSize = 16;
+
+// Run one check and print its results, counting whether it passed
+static void runCheck(int variant, int blockSize, int audioSampleRate,
+	const std::string& impulseFilename, int morph, float morphAmount, const std::string& morphFilename,
+	int maxBlocks, float sparsity, int maxKernelSize, int inputLength,
+	Verifier::Reference& reference, int& passed, int& failed)
+{
+	float maxError;
+	float snr;
+	int latency;
+	int expectedLatency;
+	bool ok = Verifier::check(variant, blockSize, audioSampleRate,
+		impulseFilename, morph, morphAmount, morphFilename,
+		maxBlocks, sparsity, maxKernelSize, inputLength, reference,
+		maxError, snr, latency, expectedLatency);
+	printf("%-8s %-22s morph: %-7s %.1f  block: %3d  maxBlocks: %2d  sparsity: %.1f  max err: %.2e  SNR: %6.1f dB  latency: %4d (%4d)  %s\n",
+		variantNames[variant], impulseFilename.c_str(), morphNames[morph], morphAmount,
+		blockSize, maxBlocks, sparsity,
+		maxError, snr, latency, expectedLatency, ok ? "OK" : "FAIL");
+	if (ok)
+		passed++;
+	else
+		failed++;
+}
+
+bool Verifier::run(const std::vector<std::string>& impulseFilenames, int audioSampleRate, int maxKernelSize, int inputLength)
+{
+	int passed = 0;
+	int failed = 0;
+	Reference reference;
+
+	// the innermost loops only change the block size and the variant, so
+	// that consecutive checks can share their reference
+	for (size_t i = 0; i < impulseFilenames.size(); i++)
+	{
+		for (auto& morph : morphSettings)
+		{
+			// morph towards the next file in the list
+			const std::string& morphFilename = impulseFilenames[(i + 1) % impulseFilenames.size()];
+			for (auto& bypass : bypassSettings)
+			{
+				for (int blockSize : blockSizes)
+				{
+					for (int variant = 0; variant < kNumVariants; variant++)
+					{
+						runCheck(variant, blockSize, audioSampleRate,
+							impulseFilenames[i], morph.morph, morph.amount, morphFilename,
+							bypass.maxBlocks, bypass.sparsity, maxKernelSize, inputLength,
+							reference, passed, failed);
+					}
+				}
+			}
+		}
+	}
+
+	// the sweep above may have shortened the impulse responses: check each
+	// of them once more as a whole, so that the largest partitions are
+	// covered too
+	printf("Full length:\n");
+	for (size_t i = 0; i < impulseFilenames.size(); i++)
+	{
+		for (auto& morph : morphSettings)
+		{
+			const std::string& morphFilename = impulseFilenames[(i + 1) % impulseFilenames.size()];
+			runCheck(kProcessBlock, defaultBlockSize, audioSampleRate,
+				impulseFilenames[i], morph.morph, morph.amount, morphFilename,
+				bypassSettings[0].maxBlocks, bypassSettings[0].sparsity, 0, inputLength,
+				reference, passed, failed);
+		}
+	}
+
+	// every position of the maxBlocks and sparsity sliders, on the first
+	// impulse response
+	printf("Bypass:\n");
+	for (int maxBlocks = 0; maxBlocks <= 30; maxBlocks++)
+	{
+		for (int sparsity = 0; sparsity <= 10; sparsity++)
+		{
+			runCheck(kProcessBlock, defaultBlockSize, audioSampleRate,
+				impulseFilenames[0], kMorphNone, 0, "",
+				maxBlocks, sparsity * 0.1f, maxKernelSize, inputLength,
+				reference, passed, failed);
+		}
+	}
+
+	printf("Verification: %d passed, %d failed\n", passed, failed);
+	return !failed;
+}
+
+bool Verifier::check(int variant, int blockSize, int audioSampleRate,
+	const std::string& impulseFilename, int morph, float morphAmount, const std::string& morphFilename,
+	int maxBlocks, float sparsity, int maxKernelSize, int inputLength, Reference& reference,
+	float& maxError, float& snr, int& latency, int& expectedLatency)
+{
+	maxError = 0;
+	snr = 0;
+	latency = -1;
+	expectedLatency = -1;
+
+	ZLConvolver convolver;
+	if (!convolver.setup(blockSize, audioSampleRate, impulseFilename, maxKernelSize, false, true,
+			kMorphNone == morph ? "" : morphFilename))
+		return false;
+
+	// build the reference impulse response: truncated to maxKernelSize and,
+	// when morphing, as long as the longer of the two. The convolver must
+	// cover all of that, zero-padded to the end of its last block
+	int kernelSize = convolver.getKernelSize();
+	std::vector<float> a = AudioFileUtilities::loadMono(impulseFilename);
+	if (maxKernelSize)
+		a.resize(std::min((int)a.size(), maxKernelSize));
+	std::vector<float> b;
+	if (kMorphNone != morph)
+	{
+		b = AudioFileUtilities::loadMono(morphFilename);
+		if (maxKernelSize)
+			b.resize(std::min((int)b.size(), maxKernelSize));
+	}
+	if ((size_t)kernelSize < std::max(a.size(), b.size()))
+		return false;
+	a.resize(kernelSize, 0);
+	std::vector<double> h(a.begin(), a.end());
+	if (kMorphNone != morph)
+	{
+		b.resize(kernelSize, 0);
+		if (kMorphComplex == morph)
+		{
+			// linear in the frequency domain is linear in the time domain
+			convolver.setMorph(morphAmount, FFTConvolver::kMorphComplex);
+			for (int n = 0; n < kernelSize; n++)
+				h[n] = a[n] + morphAmount * (b[n] - a[n]);
+		}
+		else
+		{
+			convolver.setMorph(morphAmount, FFTConvolver::kMorphPolar);
+			h = morphPolar(a, b, morphAmount, convolver.getPartitionSizes());
+		}
+	}
+	// silence the partitions which the GUI controls bypass
+	std::vector<int> partitionSizes = convolver.getPartitionSizes();
+	std::vector<bool> bypassed = getBypassed(partitionSizes.size(), maxBlocks, sparsity);
+	int k = partitionSizes[0];
+	for (size_t p = 1; p < partitionSizes.size(); p++)
+	{
+		if (bypassed[p - 1])
+			std::fill(h.begin() + k, h.begin() + k + partitionSizes[p], 0);
+		k += partitionSizes[p];
+	}
+
+	// a burst of noise, and another one once the circular buffers have
+	// wrapped around, each followed by enough silence to hear the whole tail
+	expectedLatency = convolver.getLatency();
+	int maxLatency = 2 * expectedLatency + blockSize;
+	int secondBurst = 3 * (kernelSize + expectedLatency);
+	int burstStarts[2] = { 0, secondBurst };
+	std::vector<float> bursts[2];
+	bursts[0].resize(inputLength);
+	bursts[1].resize(inputLength);
+	srand(1);
+	for (int n = 0; n < inputLength; n++)
+	{
+		bursts[0][n] = ZLConvolver::randFloat(-1, 1);
+		bursts[1][n] = ZLConvolver::randFloat(-1, 1);
+	}
+	std::vector<float> x(secondBurst + inputLength + kernelSize + maxLatency, 0);
+	for (int b = 0; b < 2; b++)
+		std::copy(bursts[b].begin(), bursts[b].end(), x.begin() + burstStarts[b]);
+
+	std::vector<float> y(x.size());
+	switch (variant)
+	{
+		case kProcessSample:
+			for (size_t n = 0; n < x.size(); n++)
+				y[n] = convolver.process(x[n], maxBlocks, sparsity);
+			break;
+		case kProcessBlock:
+			for (size_t n = 0; n < x.size(); n += blockSize)
+			{
+				int frames = std::min((size_t)blockSize, x.size() - n);
+				convolver.processBlock(&x[n], &y[n], frames, maxBlocks, sparsity);
+			}
+			break;
+	}
+
+	// the trailing zeros only depend on how the filter was partitioned
+	while (h.size() && !h.back())
+		h.pop_back();
+	if (h != reference.h)
+	{
+		reference.h = h;
+		for (int b = 0; b < 2; b++)
+			reference.bursts[b] = convolve(bursts[b], h);
+	}
+	int length = secondBurst + inputLength + kernelSize - 1;
+	std::vector<double> expected(length, 0);
+	for (int b = 0; b < 2; b++)
+	{
+		for (size_t n = 0; n < reference.bursts[b].size(); n++)
+			expected[burstStarts[b] + n] += reference.bursts[b][n];
+	}
+
+	// find the delay that best lines up the start of the output
+	// with the reference
+	int window = std::min(length, 2048);
+	double minError = -1;
+	for (int d = 0; d <= maxLatency; d++)
+	{
+		double error = 0;
+		for (int n = 0; n < window; n++)
+		{
+			double e = y[n + d] - expected[n];
+			error += e * e;
+		}
+		if (minError < 0 || error < minError)
+		{
+			minError = error;
+			latency = d;
+		}
+	}
+
+	// and compare the whole of it at that delay
+	double signalEnergy = 0;
+	double errorEnergy = 0;
+	for (int n = 0; n < length; n++)
+	{
+		double e = y[n + latency] - expected[n];
+		maxError = std::max(maxError, (float)fabs(e));
+		signalEnergy += expected[n] * expected[n];
+		errorEnergy += e * e;
+	}
+	// anything before the output should have been silent
+	for (int n = 0; n < latency; n++)
+	{
+		maxError = std::max(maxError, fabsf(y[n]));
+		errorEnergy += y[n] * y[n];
+	}
+	snr = errorEnergy ? 10 * log10(signalEnergy / errorEnergy) : INFINITY;
+
+	return latency == expectedLatency && snr >= kMinSnr;
+}
+
+std::vector<bool> Verifier::getBypassed(int partitions, int maxBlocks, float sparsity)
+{
+	int fftPartitions = partitions - 1;
+	std::vector<bool> bypassed(fftPartitions, false);
+
+	// only the first maxBlocks + 1 FFT partitions are used
+	for (int n = maxBlocks + 1; n < fftPartitions; n++)
+		bypassed[n] = true;
+
+	// sparsity drops one FFT partition in every stride, the stride going
+	// from about half the number of partitions down to 1 as the sparsity
+	// goes up, but never the first one, which holds the early reflections
+	if (sparsity)
+	{
+		int stride = (int)((1 - sparsity) * (partitions / 2)) + 1;
+		for (int n = stride; n < fftPartitions; n += stride)
+			bypassed[n] = true;
+	}
+	return bypassed;
+}
+
+std::vector<double> Verifier::morphPolar(const std::vector<float>& a, const std::vector<float>& b,
+	float amount, const std::vector<int>& partitionSizes)
+{
+	std::vector<double> h(a.size(), 0);
+	int k = 0;
+	for (size_t p = 0; p < partitionSizes.size(); p++)
+	{
+		int size = partitionSizes[p];
+		if (0 == p)
+		{
+			// the direct convolution blends linearly in either mode
+			for (int n = 0; n < size; n++)
+				h[n] = a[n] + amount * (b[n] - a[n]);
+			k += size;
+			continue;
+		}
+
+		// spectra of the two zero-padded blocks
+		int fftSize = 2 * size;
+		Fft fftA;
+		Fft fftB;
+		fftA.setup(fftSize);
+		fftB.setup(fftSize);
+		for (int n = 0; n < fftSize; n++)
+		{
+			fftA.td(n) = n < size ? a[k + n] : 0;
+			fftB.td(n) = n < size ? b[k + n] : 0;
+		}
+		fftA.fft();
+		fftB.fft();
+
+		// blend magnitude and phase, rotating along the shortest path, into
+		// a conjugate-symmetric spectrum
+		for (int n = 0; n <= size; n++)
+		{
+			double magA = hypot(fftA.fdr(n), fftA.fdi(n));
+			double magB = hypot(fftB.fdr(n), fftB.fdi(n));
+			double phaseA = atan2(fftA.fdi(n), fftA.fdr(n));
+			double delta = remainder(atan2(fftB.fdi(n), fftB.fdr(n)) - phaseA, 2 * M_PI);
+			double mag = magA + amount * (magB - magA);
+			double phase = phaseA + amount * delta;
+			fftA.fdr(n) = mag * cos(phase);
+			fftA.fdi(n) = mag * sin(phase);
+			if (n && n < size)
+			{
+				fftA.fdr(fftSize - n) = fftA.fdr(n);
+				fftA.fdi(fftSize - n) = -fftA.fdi(n);
+			}
+		}
+		fftA.ifft();
+
+		// its impulse response is longer than the block: keep what fits in it
+		for (int n = 0; n < size; n++)
+			h[k + n] = fftA.td(n);
+		k += size;
+	}
+	return h;
+}
+
+std::vector<double> Verifier::convolve(const std::vector<float>& x, const std::vector<double>& h)
+{
+	std::vector<double> y(x.size() + h.size() - 1, 0);
+	for (size_t n = 0; n < x.size(); n++)
+	{
+		if (!x[n])
+			continue;
+		for (size_t k = 0; k < h.size(); k++)
+			y[n + k] += x[n] * h[k];
+	}
+	return y;
+}
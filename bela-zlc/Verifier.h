@@ -0,0 +1,83 @@
+/***** Verifier.h *****/
+/*
+ ____  _____ _        _    
+| __ )| ____| |      / \   
+|  _ \|  _| | |     / _ \  
+| |_) | |___| |___ / ___ \ 
+|____/|_____|_____/_/   \_\
+
+http://bela.io
+
+*/
+
+// This class checks the zero-latency convolution offline, against a plain
+// double-precision direct convolution of the same impulse response.
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+class Verifier {
+public:
+	// Ways of running the convolution, each of which is checked
+	enum Variant {
+		kProcessSample = 0,	// ZLConvolver::process(), one sample at a time
+		kProcessBlock,		// ZLConvolver::processBlock(), one block at a time
+		kNumVariants
+	};
+	
+	// Impulse response being checked
+	enum Morph {
+		kMorphNone = 0,		// as loaded
+		kMorphComplex,		// morphed towards the next file, complex linear
+		kMorphPolar,		// morphed towards the next file, magnitude/phase
+		kNumMorphs
+	};
+	
+	// Reference output of the filter being checked. It does not depend on
+	// the block size or the variant, so it is kept between checks and only
+	// computed again when the filter changes
+	struct Reference {
+		std::vector<double> h;			// filter, without its trailing zeros
+		std::vector<double> bursts[2];	// each noise burst convolved with h
+	};
+	
+	// Run every check on every impulse response, printing one line for each.
+	// maxKernelSize limits the length of the impulse responses (0 for no limit)
+	// to keep the run time of the sweep down; each of them is then checked
+	// once more at full length for every morph, with a single block size
+	// and no bypass. The first one is also checked with every setting of
+	// the maxBlocks and sparsity sliders. inputLength is the
+	// length of the noise bursts fed to the convolvers. Returns true if they
+	// all pass.
+	static bool run(const std::vector<std::string>& impulseFilenames, int audioSampleRate, int maxKernelSize = 16384, int inputLength = 1024);
+	
+	// Check one configuration. Fills in the maximum absolute error, the
+	// signal-to-error ratio in dB and the measured latency in samples.
+	// reference is reused if it matches the filter, or updated otherwise.
+	// Returns true if it passes.
+	static bool check(int variant, int blockSize, int audioSampleRate,
+		const std::string& impulseFilename, int morph, float morphAmount, const std::string& morphFilename,
+		int maxBlocks, float sparsity, int maxKernelSize, int inputLength, Reference& reference,
+		float& maxError, float& snr, int& latency, int& expectedLatency);
+	
+	// Which of the FFT partitions (all but the direct one) the GUI controls
+	// should bypass: those past maxBlocks and, with a nonzero sparsity,
+	// every so many of them starting after the first one, more often the
+	// higher the sparsity. Computed here rather than asked to the convolver,
+	// so that a wrong rule in it shows up as a failed check.
+	static std::vector<bool> getBypassed(int partitions, int maxBlocks, float sparsity);
+	
+	// Magnitude/phase morph of the impulse response a towards b, computed
+	// independently for each of the partitions the convolver splits it into:
+	// the time-domain blend of the direct one and, for the others, their
+	// blended spectrum truncated back to the length of the partition
+	static std::vector<double> morphPolar(const std::vector<float>& a, const std::vector<float>& b,
+		float amount, const std::vector<int>& partitionSizes);
+	
+	// Direct form convolution of x with h, in double precision
+	static std::vector<double> convolve(const std::vector<float>& x, const std::vector<double>& h);
+	
+	static constexpr float kMinSnr = 80;	// dB, below this a check fails
+};
@@ -4,14 +4,16 @@
 #include <libraries/AudioFile/AudioFile.h>
 
 // Constructor taking the path of a file to load
-ZLConvolver::ZLConvolver(int blockSize, int audioSampleRate, std::string impulseFilename, int maxKernelSize, bool random)
+ZLConvolver::ZLConvolver(int blockSize, int audioSampleRate, std::string impulseFilename, int maxKernelSize, bool random, bool synchronous, std::string morphFilename)
 {
-	setup(blockSize, audioSampleRate, impulseFilename, maxKernelSize, random);
+	setup(blockSize, audioSampleRate, impulseFilename, maxKernelSize, random, synchronous, morphFilename);
 }
 
-bool ZLConvolver::setup(int blockSize, int audioSampleRate, std::string impulseFilename, int maxKernelSize, bool random)
+bool ZLConvolver::setup(int blockSize, int audioSampleRate, std::string impulseFilename, int maxKernelSize, bool random, bool synchronous, std::string morphFilename)
 {
 	random_ = random;
+	synchronous_ = synchronous;
+	morphing_ = false;
 	std::vector<float> impulsePlayer;
 	int kernelSize = maxKernelSize;
 
@@ -29,12 +31,37 @@ bool ZLConvolver::setup(int blockSize, int audioSampleRate, std::string impulseF
 			kernelSize = std::min(kernelSize, maxKernelSize);
 
 		// Print some useful info
-		printf("Loaded the impulse response file '%s' with %d frames (%.1f seconds)\n",
-				  impulseFilename.c_str(), kernelSize,
-				  kernelSize/ float(audioSampleRate));
+		if (!synchronous_)
+			printf("Loaded the impulse response file '%s' with %d frames (%.1f seconds)\n",
+					  impulseFilename.c_str(), kernelSize,
+					  kernelSize/ float(audioSampleRate));
 
 	}
 
+	std::vector<float> morphTarget;
+	if (morphFilename.size())
+	{
+		morphTarget = AudioFileUtilities::loadMono(morphFilename);
+		if (!morphTarget.size())
+		{
+			printf("Error loading morph target file '%s'\n", morphFilename.c_str());
+			return false;
+		}
+		if (maxKernelSize)
+			morphTarget.resize(std::min((int)morphTarget.size(), maxKernelSize));
+
+		// split the longer of the two impulse responses into partitions,
+		// padding the other one, so that neither loses its tail
+		kernelSize = std::max(kernelSize, (int)morphTarget.size());
+		if (!random)
+			impulsePlayer.resize(kernelSize, 0);
+
+		if (!synchronous_)
+			printf("Loaded the morph target file '%s' with %d frames (%.1f seconds)\n",
+					  morphFilename.c_str(), (int)morphTarget.size(),
+					  morphTarget.size() / float(audioSampleRate));
+	}
+
 	// Set up the FFT and buffers
 
 	// N_ = 32 is the smallest N such that
@@ -45,19 +72,18 @@ bool ZLConvolver::setup(int blockSize, int audioSampleRate, std::string impulseF
 	// add some latency to give time to the extra threads to
 	// perform their work after being scheduled
 	// TODO: not sure this is the minimum possible value
-	int addedLatency = 2 * N_;
-	inputBuffer_.resize(kernelSize + addedLatency);
-	outputBuffer_.resize(kernelSize + addedLatency);
-	outputBufferReadPointer_ = outputBuffer_.size() - addedLatency;
+	addedLatency_ = 2 * N_;
 
 	// Here we create an array of fftConvolvers
 	// each has a separate block of the impulse response
 	int k = 0; // starting position in the impulse response
 	int samplesRead = 0;
+	int maxBlockSize = 0;
 	blocks_ = 0;
 	std::vector<float> h;
 
-	while (samplesRead < kernelSize)
+	// keep going until the last block is complete, zero-padding it
+	while (samplesRead < kernelSize || h.size())
 	{
 		int fftSize = 0;
 		bool direct = false; // use direct form conv. for first block
@@ -74,10 +100,13 @@ bool ZLConvolver::setup(int blockSize, int audioSampleRate, std::string impulseF
 		else
 			fftSize = (int)powf(2, (blocks_ / 2) - 1) * N_;
 
-		if (!random)
-			value = impulsePlayer[samplesRead++];
+		if (samplesRead >= kernelSize)
+			value = 0;
+		else if (!random)
+			value = impulsePlayer[samplesRead];
 		else
 			value = randFloat(-0.1, 0.1);
+		samplesRead++;
 
 		h.push_back(value);
 
@@ -97,18 +126,30 @@ bool ZLConvolver::setup(int blockSize, int audioSampleRate, std::string impulseF
 				fftConvolvers_.push_back(convolver);
 				convolverBufferSamples_.push_back(0);
 				convolverPriority_.push_back(priority);
-				printf("n: %d  fftSize: %d. priority: %d samplesRead: %d  k: %d\n", blocks_, fftSize, priority, samplesRead, k);
+				if (!synchronous_)
+					printf("n: %d  fftSize: %d. priority: %d samplesRead: %d  k: %d\n", blocks_, fftSize, priority, samplesRead, k);
 			}
 
+			maxBlockSize = std::max(maxBlockSize, fftSize / 2);
 			blocks_++;
 			h.clear(); // remove all elements from h
 			k = samplesRead;
 		}
 	}
+	kernelSize_ = samplesRead;
+
+	// The convolvers only keep a pointer to the circular buffers, so we can
+	// size them now. The overlap-add of the last block spans twice its
+	// length, which must not wrap around onto samples yet to be read.
+	// The guard of the input buffer lets every block be read contiguously.
+	inputBuffer_.setup(kernelSize_ + addedLatency_, maxBlockSize);
+	outputBuffer_.setup(kernelSize_ + addedLatency_ + maxBlockSize, 0);
+	inputBufferPointer_ = 0;
+	outputBufferReadPointer_ = outputBuffer_.size() - addedLatency_;
 
 	// create threads for FFT convolutions
 	// each convolver will have its own thread
-	for (int n = 0; n < fftConvolvers_.size(); n++)
+	for (int n = 0; n < fftConvolvers_.size() && !synchronous_; n++)
 	{
 		convolverThreads_.push_back(
 			Bela_createAuxiliaryTask(
@@ -118,36 +159,150 @@ bool ZLConvolver::setup(int blockSize, int audioSampleRate, std::string impulseF
 				&fftConvolvers_[n]));
 	}
 
-	printf("Splitting impulse into %d blocks.\n", blocks_);
+	if (!synchronous_)
+		printf("Splitting impulse into %d blocks.\n", blocks_);
+
+	if (morphTarget.size())
+		setMorphTarget(morphTarget);
 
 	return true;
 }
 
-float ZLConvolver::process(float in, int maxBlocks, float sparsity)
+void ZLConvolver::setMorphTarget(std::vector<float>& impulsePlayer)
 {
-	// store input sample into input circular buffer
-	inputBuffer_[inputBufferPointer_++] = in;
-	if (inputBufferPointer_ >= inputBuffer_.size())
+	// pad it to the end of the last block
+	impulsePlayer.resize(kernelSize_, 0);
+
+	// split it into the same partitions as the impulse response
+	std::vector<float> h;
+	h.assign(impulsePlayer.begin(), impulsePlayer.begin() + directConvolver_.getSize());
+	directConvolver_.setMorphTarget(h);
+	for (int n = 0; n < fftConvolvers_.size(); n++)
+	{
+		int k = fftConvolvers_[n].getOffset();
+		h.assign(impulsePlayer.begin() + k, impulsePlayer.begin() + k + fftConvolvers_[n].getFftSize() / 2);
+		fftConvolvers_[n].setMorphTarget(h);
+	}
+
+	if (!morphing_ && !synchronous_)
+	{
+		// run below all the convolver threads
+		morphThread_ = Bela_createAuxiliaryTask(
+			morphLauncher,
+			basePriority_ - blocks_,
+			"morphLauncher",
+			this);
+	}
+	morphing_ = true;
+}
+
+void ZLConvolver::setMorph(float amount, int mode)
+{
+	if (!morphing_)
+		return;
+
+	amount = std::min(1.f, std::max(0.f, amount));
+	if (amount != morphAmount_->load(std::memory_order_relaxed) || mode != morphMode_->load(std::memory_order_relaxed))
+	{
+		morphMode_->store(mode, std::memory_order_relaxed);
+		morphAmount_->store(amount, std::memory_order_relaxed);
+		morphRequested_->fetch_add(1, std::memory_order_release);
+	}
+	if (synchronous_)
+	{
+		// offline, bring all the partitions up to date straight away
+		updateMorph(true);
+	}
+	else if (morphRequested_->load(std::memory_order_relaxed) != morphDone_->load(std::memory_order_acquire))
+	{
+		// only wake the morph thread while some partitions are out of date
+		Bela_scheduleAuxiliaryTask(morphThread_);
+	}
+}
+
+void ZLConvolver::updateMorph(bool all)
+{
+	unsigned int requested = morphRequested_->load(std::memory_order_acquire);
+	float amount = morphAmount_->load(std::memory_order_relaxed);
+	int mode = morphMode_->load(std::memory_order_relaxed);
+	bool done = true;
+
+	// the direct convolution reads its coefficients on every sample, and
+	// blending them is cheap
+	if (!directConvolver_.isMorphed(amount))
+		directConvolver_.morph(amount);
+
+	// a moving morph would otherwise blend a large partition many times
+	// over before it is used once: only update each of them once per block
+	// of that partition, so that the cost is in line with the convolution
+	for (int n = 0; n < fftConvolvers_.size(); n++)
 	{
-		inputBufferPointer_ = 0;
+		if (fftConvolvers_[n].isMorphed(amount, mode))
+			continue;
+		if (all || fftConvolvers_[n].isMorphDue())
+			fftConvolvers_[n].morph(amount, mode);
+		else
+			done = false;
 	}
 
+	// if the request changed in the meantime, morphRequested_ has moved on
+	// and the audio thread will schedule us again
+	if (done)
+		morphDone_->store(requested, std::memory_order_release);
+}
+
+int ZLConvolver::getLatency()
+{
+	return addedLatency_;
+}
+
+int ZLConvolver::getKernelSize()
+{
+	return kernelSize_;
+}
+
+std::vector<int> ZLConvolver::getPartitionSizes()
+{
+	std::vector<int> sizes;
+	sizes.push_back(directConvolver_.getSize());
+	for (int n = 0; n < fftConvolvers_.size(); n++)
+		sizes.push_back(fftConvolvers_[n].getFftSize() / 2);
+	return sizes;
+}
+
+bool ZLConvolver::isBypassed(int n, int maxBlocks, float sparsity)
+{
+	// based on the GUI controls we may ignore some blocks in the filter.
+	// The first one, right after the direct convolution, holds the early
+	// reflections and is only dropped by maxBlocks
+	return (sparsity && n && n % (int)(((1 - sparsity) * (blocks_ / 2)) + 1) == 0) || n > maxBlocks;
+}
+
+void ZLConvolver::launch(int n, unsigned int inPointer, bool bypass)
+{
+	fftConvolvers_[n].queue(inPointer, bypass);
+	if (synchronous_)
+		convolverLauncher(&fftConvolvers_[n]);
+	else
+		Bela_scheduleAuxiliaryTask(convolverThreads_[n]);
+}
+
+float ZLConvolver::process(float in, int maxBlocks, float sparsity)
+{
+	// store input sample into input circular buffer
+	inputBuffer_.write(inputBufferPointer_, &in, 1);
+	inputBufferPointer_ = inputBuffer_.wrap(inputBufferPointer_ + 1);
+
 	// direct convolution
-	//directConvolver_.process(inputBufferPointer_);
+	directConvolver_.process(inputBufferPointer_);
 
 	// iterate over FFT convolutions
-	for (int n = 2; n < fftConvolvers_.size(); n++)
+	for (int n = 0; n < fftConvolvers_.size(); n++)
 	{
-		// based on the GUI controls we may ignore some blocks in the filter
-		bool bypass = false;
-		if ((sparsity && n % (int)(((1 - sparsity) * (blocks_ / 2)) + 1) == 0) || n > maxBlocks)
-			bypass = true;
-
 		// when enough samples are loaded, we will launch the correct convolver threads
 		if (++convolverBufferSamples_[n] == (fftConvolvers_[n].getFftSize() / 2))
 		{
-			fftConvolvers_[n].queue(inputBufferPointer_, bypass);
-			Bela_scheduleAuxiliaryTask(convolverThreads_[n]);
+			launch(n, inputBufferPointer_, isBypassed(n, maxBlocks, sparsity));
 			convolverBufferSamples_[n] = 0; // reset this convolver until buffer is full
 		}
 	}
@@ -161,9 +316,38 @@ float ZLConvolver::process(float in, int maxBlocks, float sparsity)
 	//FFTConvolver::writeMutex.unlock();
 
 	// Increment the read pointer in the output circular buffer
-	outputBufferReadPointer_++;
-	if (outputBufferReadPointer_ >= outputBuffer_.size())
-		outputBufferReadPointer_ = 0;
+	outputBufferReadPointer_ = outputBuffer_.wrap(outputBufferReadPointer_ + 1);
 
 	return out;
 }
+
+void ZLConvolver::processBlock(const float* in, float* out, unsigned int frames, int maxBlocks, float sparsity)
+{
+	// store the input block into the input circular buffer,
+	// then compute the direct convolution for each of its samples
+	inputBuffer_.write(inputBufferPointer_, in, frames);
+	for (unsigned int n = 0; n < frames; n++)
+	{
+		inputBufferPointer_ = inputBuffer_.wrap(inputBufferPointer_ + 1);
+		directConvolver_.process(inputBufferPointer_);
+	}
+
+	// launch the FFT convolutions whose block of input is now complete,
+	// pointing each at the position in the input where it was completed
+	for (int n = 0; n < fftConvolvers_.size(); n++)
+	{
+		int blockSize = fftConvolvers_[n].getFftSize() / 2;
+		int samples = convolverBufferSamples_[n] + frames;
+		while (samples >= blockSize)
+		{
+			samples -= blockSize;
+			launch(n, inputBuffer_.wrap(inputBufferPointer_ - samples), isBypassed(n, maxBlocks, sparsity));
+		}
+		convolverBufferSamples_[n] = samples;
+	}
+
+	// Get the output block from the output buffer and clear it so it is
+	// ready for the next overlap-add
+	outputBuffer_.read(outputBufferReadPointer_, out, frames);
+	outputBufferReadPointer_ = outputBuffer_.wrap(outputBufferReadPointer_ + frames);
+}
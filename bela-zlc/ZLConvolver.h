@@ -18,6 +18,7 @@ http://bela.io
 #include <vector>
 #include <string>
 #include <memory>
+#include <atomic>
 
 #include "FFTConvolver.h"
 #include "DirectConvolver.h"
@@ -26,10 +27,15 @@ class ZLConvolver {
 public:
 	// Constructors: the one with arguments automatically calls setup()
 	ZLConvolver() {}
-	ZLConvolver(int blockSize, int audioSampleRate, std::string impulseFilename, int maxKernelSize = 0, bool random = false);
+	ZLConvolver(int blockSize, int audioSampleRate, std::string impulseFilename, int maxKernelSize = 0, bool random = false, bool synchronous = false, std::string morphFilename = "");
 	
 	// Create a zero-latency convolver. Returns true on success.
-	bool setup(int blockSize, int audioSampleRate, std::string impulseFilename, int maxKernelSize = 0, bool random = false);
+	// With synchronous, the FFT convolutions run in the calling thread
+	// instead of auxiliary tasks, for offline use.
+	// morphFilename optionally loads a second impulse response to morph
+	// towards with setMorph(). The two are partitioned for the longer of
+	// them, padding the other.
+	bool setup(int blockSize, int audioSampleRate, std::string impulseFilename, int maxKernelSize = 0, bool random = false, bool synchronous = false, std::string morphFilename = "");
 	
 	// After passing pointer to convolver, launch the convolver
 	static void convolverLauncher(void * convolverPtr)
@@ -39,6 +45,12 @@ public:
 		}
 	}
 	
+	// After passing pointer to a ZLConvolver, update the morph of the partitions
+	static void morphLauncher(void * convolverPtr)
+	{
+		((ZLConvolver *) convolverPtr)->updateMorph();
+	}
+	
 	// Generate a random float between low and high
 	static float randFloat(float low, float high)
 	{
@@ -48,9 +60,48 @@ public:
 	
 	float process(float in, int maxBlocks, float sparsity);
 	
+	// Process a block of frames samples: same as calling process() on each
+	// of them, with the per-sample work hoisted out. in and out may be the
+	// same buffer.
+	void processBlock(const float* in, float* out, unsigned int frames, int maxBlocks, float sparsity);
+	
+	// retrieve the delay of the output in samples
+	int getLatency(void);
+	
+	// retrieve the length of the impulse response in use, padded to the
+	// end of the last block
+	int getKernelSize(void);
+	
+	// retrieve the length of each partition of the impulse response, in
+	// order, starting with the direct convolution
+	std::vector<int> getPartitionSizes(void);
+	
+	// check whether FFT convolver n is skipped with the given GUI controls
+	bool isBypassed(int n, int maxBlocks, float sparsity);
+	
+	// Set the morph between the impulse response passed to setup() (0) and
+	// the morph target (1), see FFTConvolver::MorphMode for mode.
+	// Call once per block from the audio thread: the partitions are updated
+	// in a separate thread, each at most once per block of that partition.
+	void setMorph(float amount, int mode = FFTConvolver::kMorphComplex);
+	
 private:
 	
+	// Split the morph target into the same partitions as the impulse
+	// response, padding it to the same length
+	void setMorphTarget(std::vector<float>& impulsePlayer);
+	
+	// Queue FFT convolver n with the block of input ending before inPointer
+	void launch(int n, unsigned int inPointer, bool bypass);
+	
+	// Bring the partitions which are not up to date to the current morph,
+	// each at most once per block of that partition unless all is set
+	void updateMorph(bool all = false);
+	
 	bool random_;		// randomly generate the filter (not implemented)
+	bool synchronous_;	// run the FFT convolutions in the calling thread
+	int kernelSize_;	// number of samples in the impulse response
+	int addedLatency_;	// delay of the output, giving time to the threads
 	
 	// FFT
 	int N_; 									// base FFT size
@@ -63,9 +114,21 @@ private:
 	std::vector<int> convolverPriority_;		// array of priority values for each convolver thread
 
 	// Input and Output circular buffers
-	std::vector<float> inputBuffer_;
-	int inputBufferPointer_ = 0;
-	std::vector<float> outputBuffer_;
-	int outputBufferReadPointer_ = 0;
+	CircularBuffer inputBuffer_;
+	unsigned int inputBufferPointer_ = 0;
+	CircularBuffer outputBuffer_;
+	unsigned int outputBufferReadPointer_ = 0;
+	
+	// Morphing
+	bool morphing_ = false;						// whether a morph target is loaded
+	// requested blend and mode, written by the audio thread and read by the
+	// morph thread. Shared so that the convolver stays copyable
+	std::shared_ptr<std::atomic<float>> morphAmount_ = std::make_shared<std::atomic<float>>(0);
+	std::shared_ptr<std::atomic<int>> morphMode_ = std::make_shared<std::atomic<int>>(FFTConvolver::kMorphComplex);
+	// incremented on every change of the requested morph, and the last
+	// value of it which all the partitions were brought up to date with
+	std::shared_ptr<std::atomic<unsigned int>> morphRequested_ = std::make_shared<std::atomic<unsigned int>>(0);
+	std::shared_ptr<std::atomic<unsigned int>> morphDone_ = std::make_shared<std::atomic<unsigned int>>(0);
+	AuxiliaryTask morphThread_;					// updates the partitions in the background
 
 };
@@ -1,11 +1,11 @@
 #include <Bela.h>
 #include <libraries/Scope/Scope.h>
-#include <libraries/math_neon/math_neon.h>
 #include <libraries/Gui/Gui.h>
 #include <libraries/GuiController/GuiController.h>
 #include "DirectConvolver.h"
 #include "FFTConvolver.h"
 #include "ZLConvolver.h"
+#include "PostProcessor.h"
 
 #include <vector>
 #include <cmath>
@@ -14,11 +14,13 @@
 
 #define PLAYBACK
 #define MULTICHANNEL
+#define MORPH
+//#define VERIFY
 
 #ifdef PLAYBACK
-#include <libraries/AudioFile/AudioFile.h>
-std::vector<float> gPlayer;
-size_t gReadPtr;
+#include "StreamingPlayer.h"
+StreamingPlayer gPlayer;
+Ramp gInGain;
 std::string gAudioFilename = "audio/riff.wav";
 #endif // PLAYBACK
 
@@ -32,9 +34,36 @@ std::vector<std::string> gImpulseFilenames = {
 	//"audio/church.wav",
 };
 
+#ifdef MORPH
+// Impulse responses to morph towards, one for each of the above
+std::vector<std::string> gMorphFilenames = {
+	"audio/room.wav",
+	"audio/plate.wav",
+};
+#endif // MORPH
+
+#ifdef VERIFY
+#include "Verifier.h"
+// Impulse responses to check the convolution with
+std::vector<std::string> gVerifyFilenames = {
+	"audio/church.wav",
+	"audio/drum_room.wav",
+	"audio/large_room.wav",
+	"audio/plate.wav",
+	"audio/room.wav",
+	"audio/studio.wav",
+};
+#endif // VERIFY
+
 // zero-latency convolvers
 std::vector<ZLConvolver> gConvolvers;
 
+// per-channel wet/dry mix, gain and nonlinearity
+std::vector<PostProcessor> gPostProcessors;
+float gRampTime = 0.02; // seconds to smooth gain changes over
+std::vector<float> gInput; // one channel of input
+std::vector<float> gWet; // one channel of convolution output
+
 // Browser-based GUI to adjust parameters
 Gui gGui;
 GuiController gGuiController;
@@ -47,6 +76,8 @@ unsigned int gDrySlider;
 unsigned int gTanhSlider;
 unsigned int gInGainSlider;
 unsigned int gOutGainSlider;
+unsigned int gMorphSlider;
+unsigned int gMorphModeSlider;
 
 /* variables for speed testing
 int k = 0;
@@ -65,19 +96,24 @@ size_t gNumChannels;
 
 bool setup(BelaContext *context, void *userData)
 {
+#ifdef VERIFY
+	// check the convolution offline against a direct form reference, then stop
+	Verifier::run(gVerifyFilenames, context->audioSampleRate);
+	return false;
+#endif // VERIFY
+
 #ifdef PLAYBACK
-	// Load the audio file
-	gPlayer = AudioFileUtilities::loadMono(gAudioFilename);
-	if (!gPlayer.size())
+	// Open the audio file, which is streamed from disk while playing
+	if (!gPlayer.setup(gAudioFilename))
 	{
 		fprintf(stderr, "Error loading audio file '%s'\n", gAudioFilename.c_str());
 		return false;
 	}
 
 	// Print some useful info
-	printf("Loaded the audio file '%s' with %d frames (%.1f seconds)\n",
-			  gAudioFilename.c_str(), gPlayer.size(),
-			  gPlayer.size() / context->audioSampleRate);
+	printf("Streaming the audio file '%s' with %u frames (%.1f seconds)\n",
+			  gAudioFilename.c_str(), gPlayer.getNumFrames(),
+			  gPlayer.getNumFrames() / context->audioSampleRate);
 	gNumChannels = context->audioOutChannels;
 #else // PLAYBACK
 	gNumChannels = std::min(context->audioInChannels, context->audioOutChannels);
@@ -107,15 +143,44 @@ bool setup(BelaContext *context, void *userData)
 	gDrySlider = gGuiController.addSlider("Dry", 0.0, 0.0, 1.0, 0.01);
 	gInGainSlider = gGuiController.addSlider("In gain (dB)", 0.0, -12.0, 12.0, 0.1);
 	gOutGainSlider = gGuiController.addSlider("Out gain (dB)", 0.0, -12.0, 12.0, 0.1);
+#ifdef MORPH
+	gMorphSlider = gGuiController.addSlider("Morph", 0.0, 0.0, 1.0, 0.01);
+	gMorphModeSlider = gGuiController.addSlider("Morph mag/phase (on/off)", 0.0, 0.0, 1.0, 1.0);
+#endif // MORPH
+
+#ifdef MORPH
+	if(gMorphFilenames.size() < gImpulseFilenames.size())
+	{
+		fprintf(stderr, "You need as many morph targets as you have IRs\n");
+		return false;
+	}
+#endif // MORPH
 
 	// setup/configure the zero-latency convolvers
 	// preallocate to avoid
 	// surprises when taking addresses of the elements
 	gConvolvers.reserve(gImpulseFilenames.size());
 	for(size_t n = 0; n < gImpulseFilenames.size(); ++n)
-		gConvolvers.emplace_back(context->audioFrames, context->audioSampleRate, gImpulseFilenames[n],
-			context->audioSampleRate * 8 // maximum IR length
-		);
+	{
+#ifdef MORPH
+		std::string morphFilename = gMorphFilenames[n];
+#else // MORPH
+		std::string morphFilename;
+#endif // MORPH
+		gConvolvers.emplace_back();
+		if(!gConvolvers.back().setup(context->audioFrames, context->audioSampleRate, gImpulseFilenames[n],
+			context->audioSampleRate * 8, // maximum IR length
+			false, false, morphFilename))
+			return false;
+	}
+
+	// buffers and smoothing for the block-based processing in render()
+	gInput.resize(context->audioFrames);
+	gWet.resize(context->audioFrames);
+	gPostProcessors.resize(gNumChannels, PostProcessor(gRampTime * context->audioSampleRate));
+#ifdef PLAYBACK
+	gInGain.setup(gRampTime * context->audioSampleRate, 1);
+#endif // PLAYBACK
 
 	/* // convolvers for speed testing
 	for (int n = 0; n < blockSize; n++)
@@ -148,35 +213,55 @@ void render(BelaContext *context, void *userData)
 	float inGainLinear = powf(10, inGain / 20);
 	float outGainLinear = powf(10, outGain / 20);
 
-	for (unsigned int n = 0; n < context->audioFrames; n++)
+#ifdef MORPH
+	// the morph is applied progressively in the background
+	float morph = gGuiController.getSliderValue(gMorphSlider);
+	int morphMode = gGuiController.getSliderValue(gMorphModeSlider) ? FFTConvolver::kMorphPolar : FFTConvolver::kMorphComplex;
+	for(size_t n = 0; n < gConvolvers.size(); ++n)
+		gConvolvers[n].setMorph(morph, morphMode);
+#endif // MORPH
+
+#ifdef PLAYBACK
+	// the same playback input goes to all the channels
+	gPlayer.process(gInput.data(), context->audioFrames);
+	gInGain.setTarget(inGainLinear);
+	gInGain.apply(gInput.data(), context->audioFrames);
+#endif // PLAYBACK
+
+	bool interleaved = context->flags & BELA_FLAG_INTERLEAVED;
+	for(unsigned int c = 0; c < gNumChannels; ++c)
 	{
-		float out;
-		for(unsigned int c = 0; c < gNumChannels; ++c)
-		{
 #ifdef PLAYBACK
-			float in = gPlayer[gReadPtr] * inGainLinear;
-#else
-			float in = audioRead(context, n, c);
+		const float* in = gInput.data();
+#else // PLAYBACK
+		const float* in;
+		if(interleaved)
+		{
+			for(unsigned int n = 0; n < context->audioFrames; ++n)
+				gInput[n] = context->audioIn[n * context->audioInChannels + c];
+			in = gInput.data();
+		} else
+			in = context->audioIn + c * context->audioFrames;
 #endif // PLAYBACK
 #ifdef MULTICHANNEL
-			out = gConvolvers[c].process(in, maxBlocks, sparsity);
+		gConvolvers[c].processBlock(in, gWet.data(), context->audioFrames, maxBlocks, sparsity);
 #else // MULTICHANNEL
-			if(0 == c)
-				out = gConvolvers[room].process(in, maxBlocks, sparsity);
+		if(0 == c)
+			gConvolvers[room].processBlock(in, gWet.data(), context->audioFrames, maxBlocks, sparsity);
 #endif // MULTICHANNEL
-			// wet dry mix
-			out = out * wet + in * dry;
-			// scale the output mix
-			out = out * outGainLinear;
-			// apply nonlinearity
-			if(nl)
-				out = tanhf_neon(out);
-			audioWrite(context, n, c, out);
+		// wet dry mix, output gain and nonlinearity, straight into the output
+		float* out;
+		unsigned int stride;
+		if(interleaved)
+		{
+			out = context->audioOut + c;
+			stride = context->audioOutChannels;
+		} else {
+			out = context->audioOut + c * context->audioFrames;
+			stride = 1;
 		}
-#ifdef PLAYBACK
-		if(++gReadPtr >= gPlayer.size())
-			gReadPtr = 0;
-#endif // PLAYBACK
+		gPostProcessors[c].process(out, stride, gWet.data(), in, context->audioFrames,
+			wet * outGainLinear, dry * outGainLinear, nl);
 	}
 
 	/* // compute timings (ignore)